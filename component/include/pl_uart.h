@@ -1,3 +1,4 @@
 #pragma once
 #include "pl_uart_types.h"
-#include "pl_uart_base.h"
\ No newline at end of file
+#include "pl_uart_base.h"
+#include "pl_uart_async.h"
\ No newline at end of file
@@ -0,0 +1,175 @@
+#pragma once
+#include "pl_common.h"
+#include "pl_uart_types.h"
+#include <coroutine>
+#include <exception>
+#include <deque>
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+class Uart;
+class UartScheduler;
+
+//==============================================================================
+
+/// @brief UART coroutine (started by UartScheduler::Spawn, the coroutine frame is destroyed when the coroutine returns)
+class UartCoroutine {
+public:
+  /// @brief UART coroutine promise
+  struct promise_type {
+    /// @brief scheduler that resumes the coroutine
+    UartScheduler* scheduler = nullptr;
+
+    UartCoroutine get_return_object() { return UartCoroutine(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  ~UartCoroutine();
+  UartCoroutine(UartCoroutine&& coroutine);
+  UartCoroutine(const UartCoroutine&) = delete;
+  UartCoroutine& operator=(const UartCoroutine&) = delete;
+
+private:
+  std::coroutine_handle<promise_type> handle;
+
+  explicit UartCoroutine(std::coroutine_handle<promise_type> handle);
+  friend class UartScheduler;
+};
+
+//==============================================================================
+
+/// @brief UART coroutine scheduler (resumes the coroutines on the task that calls Run or RunOnce)
+class UartScheduler {
+public:
+  /// @brief Creates a UART coroutine scheduler
+  UartScheduler();
+  ~UartScheduler();
+  UartScheduler(const UartScheduler&) = delete;
+  UartScheduler& operator=(const UartScheduler&) = delete;
+
+  /// @brief Schedules the start of the coroutine
+  /// @param coroutine coroutine
+  /// @return error code
+  esp_err_t Spawn(UartCoroutine coroutine);
+
+  /// @brief Schedules the resumption of the coroutine (can be called from any task, never blocks)
+  /// @param handle coroutine handle
+  /// @return error code
+  esp_err_t Schedule(std::coroutine_handle<> handle);
+
+  /// @brief Resumes the scheduled coroutines (never returns)
+  void Run();
+
+  /// @brief Resumes one scheduled coroutine
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t RunOnce(TickType_t timeout);
+
+private:
+  Mutex mutex;
+  std::deque<std::coroutine_handle<>> scheduledCoroutines;
+  SemaphoreHandle_t semaphore;
+};
+
+//==============================================================================
+
+/// @brief UART asynchronous operation
+class UartAsyncOperation {
+public:
+  bool await_ready();
+  bool await_suspend(std::coroutine_handle<UartCoroutine::promise_type> handle);
+  esp_err_t await_resume();
+
+protected:
+  /// @brief UART
+  Uart& uart;
+  /// @brief operation result
+  esp_err_t result;
+
+  /// @brief Creates a UART asynchronous operation
+  /// @param uart UART
+  /// @param result initial result (the operation completes immediately if it is an error)
+  UartAsyncOperation(Uart& uart, esp_err_t result);
+
+  /// @brief Tries to complete the operation without suspending the coroutine
+  /// @return true if the operation is complete
+  virtual bool TryComplete() = 0;
+
+  /// @brief Starts the operation after the coroutine is suspended
+  /// @return false if the operation is complete and the coroutine should not be suspended
+  virtual bool Start() = 0;
+
+  /// @brief Finishes the operation after the coroutine is resumed
+  virtual void Finish() {}
+
+  /// @brief Completes the operation and schedules the coroutine resumption
+  /// @param result operation result
+  void Complete(esp_err_t result);
+
+private:
+  std::coroutine_handle<> handle;
+  UartScheduler* scheduler = nullptr;
+  friend class Uart;
+};
+
+//==============================================================================
+
+/// @brief UART asynchronous read (returned by Uart::ReadAsync and Uart::ReadFrameAsync)
+class UartReadOperation : public UartAsyncOperation {
+public:
+  /// @brief Creates a UART asynchronous read
+  /// @param uart UART
+  /// @param dest destination (can be NULL for data discarding)
+  /// @param size data size (the data is taken as it arrives, so it is not limited by the RX buffer size)
+  /// @param frame destination frame (NULL for the data read)
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @param result initial result
+  UartReadOperation(Uart& uart, void* dest, size_t size, std::vector<uint8_t>* frame, TickType_t timeout, esp_err_t result);
+
+protected:
+  bool TryComplete() override;
+  bool Start() override;
+  void Finish() override;
+
+private:
+  void* dest;
+  size_t size;
+  std::vector<uint8_t>* frame;
+  TickType_t timeout;
+  TickType_t startTick = 0;
+  friend class Uart;
+};
+
+//==============================================================================
+
+/// @brief UART asynchronous write (returned by Uart::WriteAsync)
+class UartWriteOperation : public UartAsyncOperation {
+public:
+  /// @brief Creates a UART asynchronous write
+  /// @param uart UART
+  /// @param src source (not copied, should be valid until the operation is complete)
+  /// @param size data size
+  /// @param priority priority
+  /// @param result initial result
+  UartWriteOperation(Uart& uart, const void* src, size_t size, UartTxPriority priority, esp_err_t result);
+
+protected:
+  bool TryComplete() override;
+  bool Start() override;
+
+private:
+  const void* src;
+  size_t size;
+  UartTxPriority priority;
+};
+
+//==============================================================================
+
+}
\ No newline at end of file
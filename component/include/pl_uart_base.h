@@ -1,7 +1,13 @@
 #pragma once
 #include "pl_common.h"
 #include "pl_uart_types.h"
+#include "pl_uart_async.h"
 #include "driver/uart.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+#include <array>
+#include <deque>
 
 //==============================================================================
 
@@ -35,8 +41,38 @@ public:
   static constexpr uint8_t maxRxFifoFullThreshold = 120;
   /// @brief Default TX FIFO empty threshold
   static constexpr uint8_t defaultTxFifoEmptyThreshold = 10;
+  /// @brief Number of TX priorities
+  static constexpr int numberOfTxPriorities = (int)UartTxPriority::high + 1;
+  /// @brief Default TX priority queue task priority
+  static constexpr UBaseType_t defaultTxTaskPriority = tskIDLE_PRIORITY + 5;
+  /// @brief TX priority queue task stack size
+  static constexpr uint32_t txTaskStackSize = 2048;
+  /// @brief RX event queue size
+  static constexpr int rxEventQueueSize = 20;
+  /// @brief RX task priority
+  static constexpr UBaseType_t rxTaskPriority = tskIDLE_PRIORITY + 5;
+  /// @brief RX task stack size
+  static constexpr uint32_t rxTaskStackSize = 2560;
+  /// @brief RX line idle time that ends a frame with the idle-delimited RX framing (in the number of symbols)
+  static constexpr uint8_t rxFrameIdleTime = 4;
+  /// @brief RX timeout with the break-delimited RX framing (in the number of symbols), the data received before a break
+  /// is delivered right after the break detection
+  static constexpr uint8_t rxBreakFlushTime = 1;
+  /// @brief Broadcast address value that disables the broadcast address
+  static constexpr int noBroadcastAddress = -1;
+  /// @brief Minimum wakeup threshold (number of RX positive edges, ESP-IDF requires more than 2)
+  static constexpr int minWakeupThreshold = 3;
+  /// @brief Maximum wakeup threshold (number of RX positive edges)
+  static constexpr int maxWakeupThreshold = 0x3ff;
+  /// @brief Default wakeup threshold (number of RX positive edges)
+  static constexpr int defaultWakeupThreshold = minWakeupThreshold;
+  /// @brief Default wakeup preamble byte (alternating bits provide the maximum number of edges)
+  static constexpr uint8_t defaultWakeupPreambleByte = 0x55;
 
-  /// @brief Creates an UART
+  /// @brief Break received event (generated when the RX framing is enabled)
+  Event<Uart> breakEvent;
+
+  /// @brief Creates an UART (the buffers are allocated when the port is enabled for the first time)
   /// @param port port number
   /// @param rxBufferSize RX buffer size
   /// @param txBufferSize TX buffer size (0 selects blocking, unbuffered TX)
@@ -65,9 +101,107 @@ public:
   /// @return error code
   esp_err_t DisableLoopback();
 
+  /// @brief Enables the light sleep wakeup from the port
+  /// @param threshold number of RX positive edges that wake the chip up (the bytes that generate them are lost)
+  /// @param preamble policy for the preamble bytes received after the wakeup
+  /// @param preambleByte preamble byte
+  /// @return error code
+  esp_err_t EnableWakeup(int threshold = defaultWakeupThreshold, UartWakeupPreamble preamble = UartWakeupPreamble::keep,
+                         uint8_t preambleByte = defaultWakeupPreambleByte);
+
+  /// @brief Disables the light sleep wakeup from the port (the wakeup from the other ports stays enabled)
+  /// @return error code
+  esp_err_t DisableWakeup();
+
+  /// @brief Waits until the written data is transmitted so that it is not corrupted by the light sleep
+  /// @param timeout timeout in FreeRTOS ticks
+  /// @return error code
+  esp_err_t PrepareForLightSleep(TickType_t timeout = portMAX_DELAY);
+
+  /// @brief Applies the wakeup preamble policy after the light sleep
+  /// @param wakeupCause wakeup cause (the preamble is discarded only after the UART wakeup)
+  /// @return error code
+  esp_err_t ResumeFromLightSleep(esp_sleep_wakeup_cause_t wakeupCause = esp_sleep_get_wakeup_cause());
+
   esp_err_t Read(void* dest, size_t size) override;
   esp_err_t Write(const void* src, size_t size) override;
 
+  /// @brief Writes the frame with the specified priority
+  /// (without the TX priority queue the priority is ignored and the frame is written to the driver TX buffer directly)
+  /// @param src source
+  /// @param size frame size
+  /// @param priority priority
+  /// @return error code
+  esp_err_t Write(const void* src, size_t size, UartTxPriority priority);
+
+  /// @brief Sends a break after the previously written data
+  /// (with the TX priority queue enabled the break is sent after all the frames written before it
+  /// and before the frames written after it regardless of their priorities)
+  /// @param duration break duration in microseconds
+  /// @param markDuration mark after break duration in microseconds
+  /// @return error code
+  esp_err_t SendBreak(uint32_t duration, uint32_t markDuration = 0);
+
+  /// @brief Gets the RX framing
+  /// @return RX framing
+  UartRxFraming GetRxFraming();
+
+  /// @brief Sets the RX framing (received data is read into the internal buffer of the RX buffer size by the RX task
+  /// while the framing is enabled, the rest of the frame that does not fit into the buffer is dropped;
+  /// the internal buffer is allocated in addition to the driver RX buffer, so the RX RAM use is twice the RX buffer size)
+  /// @param framing RX framing
+  /// @return error code
+  esp_err_t SetRxFraming(UartRxFraming framing);
+
+  /// @brief Enables the address filter: RX frames (RX framing should be enabled) are dropped by the RX task
+  /// unless their first byte is the address or the broadcast address, only the accepted complete frames can be read
+  /// @param address address
+  /// @param broadcastAddress broadcast address (noBroadcastAddress disables the broadcast address)
+  /// @return error code
+  esp_err_t EnableAddressFilter(uint8_t address, int broadcastAddress = noBroadcastAddress);
+
+  /// @brief Disables the address filter
+  /// @return error code
+  esp_err_t DisableAddressFilter();
+
+  /// @brief Reads the next complete RX frame
+  /// @param frame frame
+  /// @return error code
+  esp_err_t ReadFrame(std::vector<uint8_t>& frame);
+
+  /// @brief Reads the data asynchronously (the result should be awaited with co_await in a UartCoroutine;
+  /// the RX task is started on the first asynchronous read and allocates the internal buffer of the RX buffer size
+  /// in addition to the driver RX buffer, so the RX RAM use is twice the RX buffer size)
+  /// @param dest destination (can be NULL for data discarding)
+  /// @param size data size (the data is taken as it arrives, so it is not limited by the RX buffer size)
+  /// @return awaitable read operation
+  UartReadOperation ReadAsync(void* dest, size_t size);
+
+  /// @brief Reads the next complete RX frame asynchronously (the result should be awaited with co_await in a UartCoroutine)
+  /// @param frame frame
+  /// @return awaitable read operation
+  UartReadOperation ReadFrameAsync(std::vector<uint8_t>& frame);
+
+  /// @brief Writes the frame asynchronously (the result should be awaited with co_await in a UartCoroutine;
+  /// the TX priority queue should be enabled, otherwise the operation fails with ESP_ERR_INVALID_STATE;
+  /// the coroutine is resumed when the frame is transmitted)
+  /// @param src source (not copied, should be valid until the operation is complete)
+  /// @param size frame size
+  /// @param priority priority
+  /// @return awaitable write operation
+  UartWriteOperation WriteAsync(const void* src, size_t size, UartTxPriority priority = UartTxPriority::normal);
+
+  /// @brief Enables the TX priority queue: written frames are queued in per-priority lanes and a task
+  /// transmits them one at a time starting with the highest priority non-empty lane
+  /// (the latency of a high priority frame is limited by the transmission time of one lower priority frame)
+  /// @param taskPriority TX task priority
+  /// @return error code
+  esp_err_t EnableTxPriorityQueue(UBaseType_t taskPriority = defaultTxTaskPriority);
+
+  /// @brief Disables the TX priority queue (queued frames are transmitted before the TX task exits)
+  /// @return error code
+  esp_err_t DisableTxPriorityQueue();
+
   bool IsEnabled() override;
   
   size_t GetReadableSize() override;
@@ -134,9 +268,57 @@ public:
   /// @return error code
   esp_err_t SetMode(uart_mode_t mode);
 
+  /// @brief Gets the RX buffer size
+  /// @return RX buffer size
+  int GetRxBufferSize();
+
+  /// @brief Sets the RX buffer size (the driver is reinstalled if it is already installed, the buffered data is preserved)
+  /// @param size RX buffer size
+  /// @return error code
+  esp_err_t SetRxBufferSize(int size);
+
+  /// @brief Gets the TX buffer size
+  /// @return TX buffer size
+  int GetTxBufferSize();
+
+  /// @brief Sets the TX buffer size (the driver is reinstalled if it is already installed, the buffered data is transmitted first)
+  /// @param size TX buffer size (0 selects blocking, unbuffered TX)
+  /// @return error code
+  esp_err_t SetTxBufferSize(int size);
+
+  /// @brief Writes the traffic chunks to the port preserving their inter-arrival timing
+  /// (with the loopback enabled or with TX connected to the RX of another port the traffic is fed to the RX path at line rate;
+  /// the chunks are written as normal priority frames followed by their breaks)
+  /// @param traffic traffic
+  /// @param speed timing speed-up factor (0 writes the chunks back to back)
+  /// @return error code
+  esp_err_t Replay(const UartTraffic& traffic, float speed = 1);
+
+  /// @brief Starts recording the written data and the breaks
+  /// (with the TX priority queue enabled the frames and the breaks are recorded when they are sent)
+  /// @param traffic traffic to append the written data to
+  /// @return error code
+  esp_err_t StartTxRecording(std::shared_ptr<UartTraffic> traffic);
+
+  /// @brief Stops recording the written data
+  /// @return error code
+  esp_err_t StopTxRecording();
+
 private:
+  struct TxFrame {
+    std::vector<uint8_t> data;
+    const void* src;
+    size_t size;
+    uint32_t breakDuration;
+    uint32_t markDuration;
+    UartAsyncOperation* operation;
+    uint32_t sequenceNumber;
+  };
+
   Mutex mutex;
+  EventGroupHandle_t taskEvents;
   uart_port_t port;
+  bool initialized = false;
   bool loopbackEnabled = false;
   int rxBufferSize, txBufferSize;
   int txPin, rxPin, rtsPin, ctsPin;
@@ -148,9 +330,69 @@ private:
   UartStopBits stopBits = defaultStopBits;
   UartFlowControl flowControl = defaultFlowControl;
   uart_mode_t mode = defaultMode;
+  int wakeupThreshold = 0;
+  UartWakeupPreamble wakeupPreamble = UartWakeupPreamble::keep;
+  uint8_t wakeupPreambleByte = defaultWakeupPreambleByte;
+  bool discardingWakeupPreamble = false;
+  Mutex rxMutex;
+  std::vector<uint8_t> rxBacklog;
+  size_t rxBacklogStart = 0;
+  size_t rxBacklogSize = 0;
+  UartRxFraming rxFraming = UartRxFraming::none;
+  std::deque<size_t> rxFrameSizes;
+  size_t rxFramedSize = 0;
+  bool rxBreakPending = false;
+  bool addressFilterEnabled = false;
+  uint8_t filterAddress = 0;
+  int filterBroadcastAddress = noBroadcastAddress;
+  bool rxFrameFiltered = false;
+  bool rxFrameDropped = false;
+  SemaphoreHandle_t rxSemaphore;
+  QueueHandle_t rxEventQueue = NULL;
+  TaskHandle_t rxTaskHandle = NULL;
+  bool asyncRx = false;
+  UartReadOperation* rxOperation = NULL;
+  esp_timer_handle_t rxTimeoutTimer = NULL;
+  std::shared_ptr<UartTraffic> txRecording;
+  int64_t txRecordingTime = 0;
+  Mutex txQueueMutex;
+  std::array<std::deque<TxFrame>, numberOfTxPriorities> txQueue;
+  std::array<size_t, numberOfTxPriorities> txQueueSize = {};
+  std::deque<TxFrame> txBreakQueue;
+  uint32_t txSequenceNumber = 0;
+  bool txQueueEnabled = false;
+  UBaseType_t txTaskPriority = defaultTxTaskPriority;
+  TaskHandle_t txTaskHandle = NULL;
 
   esp_err_t ConfigureParameters();
   esp_err_t ConfigureInterrupts();
+  esp_err_t ConfigureWakeup();
+  esp_err_t DiscardWakeupPreamble(TickType_t timeout);
+  esp_err_t InstallDriver();
+  esp_err_t ReinstallDriver();
+  esp_err_t ConfigureRxTask();
+  esp_err_t StopRxTask(bool keepOperation = false);
+  UartReadOperation* ReleaseRxOperation();
+  void ReceiveRxData(size_t size);
+  void ReceiveBreakData(size_t size);
+  void AddRxData(const uint8_t* src, size_t size);
+  void MoveDriverRxData();
+  void StoreRxData(const uint8_t* src, size_t size);
+  void DropRxFrame();
+  void EndRxFrame();
+  void ResizeRxBacklog(size_t capacity);
+  void CopyRxBacklog(uint8_t* dest, size_t size);
+  size_t GetReadableBacklogSize();
+  size_t TakeRxBacklog(void*& dest, size_t size);
+  esp_err_t WriteFrame(const void* src, size_t size, UartTxPriority priority, UartAsyncOperation* operation);
+  esp_err_t GenerateBreak(uint32_t duration, uint32_t markDuration);
+  void RecordTxChunk(const void* src, size_t size, uint32_t breakDuration, uint32_t markDuration);
+  static void RxTask(void* parameters);
+  static void RxTimeoutCallback(void* parameters);
+  static void TxTask(void* parameters);
+
+  friend class UartReadOperation;
+  friend class UartWriteOperation;
 };
 
 //==============================================================================
@@ -1,5 +1,6 @@
 #pragma once
 #include "stdint.h"
+#include <vector>
 
 //==============================================================================
 
@@ -39,6 +40,49 @@ enum class UartFlowControl : uint8_t {
   rtsCts = 3
 };
 
+/// @brief UART TX priority
+enum class UartTxPriority : uint8_t {
+  /// @brief low priority (bulk transfers)
+  low = 0,
+  /// @brief normal priority
+  normal = 1,
+  /// @brief high priority (control and acknowledgement frames)
+  high = 2
+};
+
+/// @brief UART RX framing
+enum class UartRxFraming : uint8_t {
+  /// @brief no framing
+  none = 0,
+  /// @brief frames are delimited by breaks (the null byte received with the break is not stored)
+  breakDelimited = 1,
+  /// @brief frames are delimited by RX line idle time
+  idleDelimited = 2
+};
+
+/// @brief UART wakeup preamble policy
+enum class UartWakeupPreamble : uint8_t {
+  /// @brief keep all the data received after the wakeup
+  keep = 0,
+  /// @brief discard the preamble bytes received after the wakeup
+  discard = 1
+};
+
+/// @brief UART traffic chunk
+struct UartTrafficChunk {
+  /// @brief delay in microseconds since the previous chunk (or since the start of the traffic for the first chunk)
+  uint64_t delay;
+  /// @brief chunk data
+  std::vector<uint8_t> data;
+  /// @brief duration in microseconds of the break sent after the data (0 if none)
+  uint32_t breakDuration = 0;
+  /// @brief duration in microseconds of the mark after the break
+  uint32_t markDuration = 0;
+};
+
+/// @brief UART traffic (sequence of timed chunks)
+using UartTraffic = std::vector<UartTrafficChunk>;
+
 //==============================================================================
 
 }
\ No newline at end of file
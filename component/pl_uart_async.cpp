@@ -0,0 +1,199 @@
+#include "pl_uart_async.h"
+#include "pl_uart_base.h"
+#include "esp_check.h"
+#include <limits>
+
+//==============================================================================
+
+static const char* TAG = "pl_uart_async";
+
+//==============================================================================
+
+namespace PL {
+
+//==============================================================================
+
+UartCoroutine::UartCoroutine(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+//==============================================================================
+
+UartCoroutine::UartCoroutine(UartCoroutine&& coroutine) : handle(coroutine.handle) {
+  coroutine.handle = nullptr;
+}
+
+//==============================================================================
+
+UartCoroutine::~UartCoroutine() {
+  // A coroutine that has not been spawned has not been started either
+  if (handle)
+    handle.destroy();
+}
+
+//==============================================================================
+
+UartScheduler::UartScheduler() {
+  // The semaphore counts the scheduled coroutines
+  semaphore = xSemaphoreCreateCounting(std::numeric_limits<UBaseType_t>::max(), 0);
+}
+
+//==============================================================================
+
+UartScheduler::~UartScheduler() {
+  // The scheduled coroutines are not waiting for any operation, so they can be destroyed without resuming
+  for (auto handle : scheduledCoroutines)
+    handle.destroy();
+  if (semaphore)
+    vSemaphoreDelete(semaphore);
+}
+
+//==============================================================================
+
+esp_err_t UartScheduler::Spawn(UartCoroutine coroutine) {
+  ESP_RETURN_ON_FALSE(coroutine.handle, ESP_ERR_INVALID_ARG, TAG, "coroutine is empty");
+  coroutine.handle.promise().scheduler = this;
+  ESP_RETURN_ON_ERROR(Schedule(coroutine.handle), TAG, "schedule failed");
+  coroutine.handle = nullptr;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t UartScheduler::Schedule(std::coroutine_handle<> handle) {
+  ESP_RETURN_ON_FALSE(semaphore, ESP_ERR_NO_MEM, TAG, "semaphore is not created");
+  // The RX and TX tasks schedule the coroutines, so the scheduling must not wait for the coroutines to run
+  {
+    LockGuard lg(mutex);
+    scheduledCoroutines.push_back(handle);
+  }
+  xSemaphoreGive(semaphore);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void UartScheduler::Run() {
+  while (true)
+    RunOnce(portMAX_DELAY);
+}
+
+//==============================================================================
+
+esp_err_t UartScheduler::RunOnce(TickType_t timeout) {
+  ESP_RETURN_ON_FALSE(semaphore, ESP_ERR_NO_MEM, TAG, "semaphore is not created");
+  if (xSemaphoreTake(semaphore, timeout) != pdTRUE)
+    return ESP_ERR_TIMEOUT;
+  std::coroutine_handle<> handle;
+  {
+    LockGuard lg(mutex);
+    handle = scheduledCoroutines.front();
+    scheduledCoroutines.pop_front();
+  }
+  handle.resume();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+UartAsyncOperation::UartAsyncOperation(Uart& uart, esp_err_t result) : uart(uart), result(result) {}
+
+//==============================================================================
+
+bool UartAsyncOperation::await_ready() {
+  return result != ESP_OK || TryComplete();
+}
+
+//==============================================================================
+
+bool UartAsyncOperation::await_suspend(std::coroutine_handle<UartCoroutine::promise_type> handle) {
+  this->handle = handle;
+  scheduler = handle.promise().scheduler;
+  return Start();
+}
+
+//==============================================================================
+
+esp_err_t UartAsyncOperation::await_resume() {
+  if (result == ESP_OK)
+    Finish();
+  return result;
+}
+
+//==============================================================================
+
+void UartAsyncOperation::Complete(esp_err_t result) {
+  this->result = result;
+  if (scheduler->Schedule(handle) != ESP_OK)
+    ESP_LOGE(TAG, "coroutine resumption failed");
+}
+
+//==============================================================================
+
+UartReadOperation::UartReadOperation(Uart& uart, void* dest, size_t size, std::vector<uint8_t>* frame, TickType_t timeout, esp_err_t result) :
+  UartAsyncOperation(uart, result), dest(dest), size(size), frame(frame), timeout(timeout) {}
+
+//==============================================================================
+
+bool UartReadOperation::TryComplete() {
+  LockGuard lg(uart.rxMutex);
+  if (frame)
+    return !uart.rxFrameSizes.empty();
+  // The data is taken as it arrives, so the read size is not limited by the backlog size
+  size -= uart.TakeRxBacklog(dest, size);
+  return !size;
+}
+
+//==============================================================================
+
+bool UartReadOperation::Start() {
+  LockGuard lg(uart.rxMutex);
+  if (TryComplete())
+    return false;
+  if (!uart.rxTaskHandle || uart.rxOperation) {
+    result = ESP_ERR_INVALID_STATE;
+    return false;
+  }
+  startTick = xTaskGetTickCount();
+  uart.rxOperation = this;
+  // The timer completes the operation on timeout without waking the RX task up
+  if (timeout != portMAX_DELAY)
+    esp_timer_start_once(uart.rxTimeoutTimer, (uint64_t)timeout * portTICK_PERIOD_MS * 1000);
+  return true;
+}
+
+//==============================================================================
+
+void UartReadOperation::Finish() {
+  if (!frame)
+    return;
+  LockGuard lg(uart.rxMutex);
+  if (!uart.rxFrameSizes.size()) {
+    result = ESP_ERR_TIMEOUT;
+    return;
+  }
+  frame->resize(uart.rxFrameSizes.front());
+  void* frameDest = frame->data();
+  uart.TakeRxBacklog(frameDest, frame->size());
+}
+
+//==============================================================================
+
+UartWriteOperation::UartWriteOperation(Uart& uart, const void* src, size_t size, UartTxPriority priority, esp_err_t result) :
+  UartAsyncOperation(uart, result), src(src), size(size), priority(priority) {}
+
+//==============================================================================
+
+bool UartWriteOperation::TryComplete() {
+  return !size;
+}
+
+//==============================================================================
+
+bool UartWriteOperation::Start() {
+  // The frame is queued without waiting for the lane to drain, the TX task resumes the coroutine when it is transmitted
+  result = uart.WriteFrame(src, size, priority, this);
+  return result == ESP_OK;
+}
+
+//==============================================================================
+
+}
\ No newline at end of file
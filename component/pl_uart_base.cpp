@@ -1,6 +1,9 @@
 #include "pl_uart_base.h"
 #include "esp_check.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
 #include <map>
+#include <algorithm>
 #include "hal/uart_hal.h"
 
 //==============================================================================
@@ -21,6 +24,10 @@
 #endif
 
 static const char* TAG = "pl_uart_base";
+static constexpr uart_event_type_t rxTaskStopEvent = UART_EVENT_MAX;
+static constexpr EventBits_t txFrameDequeuedBit = 1 << 0;
+static constexpr EventBits_t txTaskExitedBit = 1 << 1;
+static constexpr EventBits_t rxTaskExitedBit = 1 << 2;
 
 //==============================================================================
 
@@ -28,6 +35,43 @@ namespace PL {
 
 //==============================================================================
 
+static void WaitUntil(int64_t time);
+static TickType_t GetRemainingTime(TickType_t startTick, TickType_t timeout);
+
+/// @brief Timer that lets the calling task sleep until the given time instead of busy-waiting
+class SleepTimer {
+public:
+  /// @brief Spin margin before the wake up time (in microseconds) that covers the timer and the task switch latency
+  static constexpr int64_t spinMargin = 100;
+
+  SleepTimer();
+  ~SleepTimer();
+  SleepTimer(const SleepTimer&) = delete;
+  SleepTimer& operator=(const SleepTimer&) = delete;
+
+  /// @brief Checks if the timer has been created
+  /// @return true if created
+  bool IsCreated() const;
+
+  /// @brief Sleeps until the spin margin before the given time and busy-waits for the rest
+  /// @param time time (esp_timer_get_time)
+  void SleepUntil(int64_t time);
+
+private:
+  SemaphoreHandle_t semaphore = NULL;
+  esp_timer_handle_t timer = NULL;
+
+  static void TimerCallback(void* semaphore);
+};
+
+//==============================================================================
+
+// Ports with the light sleep wakeup enabled (ESP-IDF disables the UART wakeup for all ports at once)
+static Mutex wakeupMutex;
+static uint32_t wakeupPorts = 0;
+
+//==============================================================================
+
 static std::map<uint16_t, uart_word_length_t> dataBitsMap {
   {5, UART_DATA_5_BITS}, {6, UART_DATA_6_BITS}, {7, UART_DATA_7_BITS}, {8, UART_DATA_8_BITS}};
 
@@ -48,7 +92,15 @@ const std::string Uart::defaultName = "UART";
 //==============================================================================
 
 Uart::Uart(uart_port_t port, int rxBufferSize, int txBufferSize, int txPin, int rxPin, int rtsPin, int ctsPin) :
-    port(port), txPin(txPin), rxPin(rxPin), rtsPin(rtsPin), ctsPin(ctsPin) {
+    breakEvent(*this), port(port), txPin(txPin), rxPin(rxPin), rtsPin(rtsPin), ctsPin(ctsPin) {
+  rxSemaphore = xSemaphoreCreateBinary();
+  taskEvents = xEventGroupCreate();
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = RxTimeoutCallback;
+  timerArgs.arg = this;
+  timerArgs.dispatch_method = ESP_TIMER_TASK;
+  timerArgs.name = "pl_uart_rx_timeout";
+  esp_timer_create(&timerArgs, &rxTimeoutTimer);
   this->rxBufferSize = std::max((rxBufferSize + 3) / 4 * 4, minBufferSize);
   this->txBufferSize = txBufferSize == 0 ? 0 : std::max((txBufferSize + 3) / 4 * 4, minBufferSize);
   SetName(defaultName + std::to_string(port - UART_NUM_0));
@@ -57,8 +109,17 @@ Uart::Uart(uart_port_t port, int rxBufferSize, int txBufferSize, int txPin, int
 //==============================================================================
 
 Uart::~Uart() {
-  if (uart_is_driver_installed(port))
+  DisableWakeup();
+  DisableTxPriorityQueue();
+  if (uart_is_driver_installed(port)) {
+    LockGuard lg(*this);
+    StopRxTask();
     uart_driver_delete(port);
+  }
+  esp_timer_stop(rxTimeoutTimer);
+  esp_timer_delete(rxTimeoutTimer);
+  vSemaphoreDelete(rxSemaphore);
+  vEventGroupDelete(taskEvents);
 }
 
 //==============================================================================
@@ -81,13 +142,13 @@ esp_err_t Uart::Unlock() {
 
 esp_err_t Uart::Initialize() {
   LockGuard lg(*this);
-  if (uart_is_driver_installed(port))
+  if (initialized || uart_is_driver_installed(port)) {
+    initialized = true;
     return ESP_OK;
+  }
   ESP_RETURN_ON_ERROR(ConfigureParameters(), TAG, "configure parameters failed");
   ESP_RETURN_ON_ERROR(uart_set_pin(port, txPin, rxPin, rtsPin, ctsPin), TAG, "set pins failed");
-  ESP_RETURN_ON_ERROR(uart_driver_install(port, rxBufferSize, txBufferSize, 0, NULL, 0), TAG, "driver install failed");
-  ESP_RETURN_ON_ERROR(ConfigureInterrupts(), TAG, "configure interrupts failed");
-  ESP_RETURN_ON_ERROR(uart_set_mode(port, mode), TAG, "set mode failed");
+  initialized = true;
   return ESP_OK;
 }
 
@@ -95,9 +156,13 @@ esp_err_t Uart::Initialize() {
 
 esp_err_t Uart::Enable() {
   LockGuard lg(*this);
-  ESP_RETURN_ON_FALSE(uart_is_driver_installed(port), ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
+  ESP_RETURN_ON_FALSE(initialized, ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
   if (enabled)
     return ESP_OK;
+  // The driver (and its buffers) is installed on the first enable
+  if (!uart_is_driver_installed(port)) {
+    ESP_RETURN_ON_ERROR(InstallDriver(), TAG, "install driver failed");
+  }
   enabled = true; 
   Read(NULL, GetReadableSize());
   enabledEvent.Generate();
@@ -108,7 +173,7 @@ esp_err_t Uart::Enable() {
 
 esp_err_t Uart::Disable() {
   LockGuard lg(*this);
-  ESP_RETURN_ON_FALSE(uart_is_driver_installed(port), ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
+  ESP_RETURN_ON_FALSE(initialized, ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
   if (!enabled)
     return ESP_OK;
   enabled = false;
@@ -120,8 +185,9 @@ esp_err_t Uart::Disable() {
 
 esp_err_t Uart::EnableLoopback() {
   LockGuard lg(*this);
-  ESP_RETURN_ON_FALSE(uart_is_driver_installed(port), ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
+  ESP_RETURN_ON_FALSE(initialized, ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
   ESP_RETURN_ON_ERROR(uart_set_loop_back(port, true), TAG, "enable loopback failed");
+  loopbackEnabled = true;
   return ESP_OK;
 }
 
@@ -129,8 +195,75 @@ esp_err_t Uart::EnableLoopback() {
 
 esp_err_t Uart::DisableLoopback() {
   LockGuard lg(*this);
-  ESP_RETURN_ON_FALSE(uart_is_driver_installed(port), ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
+  ESP_RETURN_ON_FALSE(initialized, ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
   ESP_RETURN_ON_ERROR(uart_set_loop_back(port, false), TAG, "disable loopback failed");
+  loopbackEnabled = false;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::EnableWakeup(int threshold, UartWakeupPreamble preamble, uint8_t preambleByte) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(threshold >= minWakeupThreshold && threshold <= maxWakeupThreshold, ESP_ERR_INVALID_ARG, TAG,
+                      "invalid wakeup threshold (%d)", threshold);
+  wakeupThreshold = threshold;
+  wakeupPreamble = preamble;
+  wakeupPreambleByte = preambleByte;
+  if (uart_is_driver_installed(port)) {
+    ESP_RETURN_ON_ERROR(ConfigureWakeup(), TAG, "configure wakeup failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::DisableWakeup() {
+  LockGuard lg(*this);
+  {
+    LockGuard lgRx(rxMutex);
+    discardingWakeupPreamble = false;
+  }
+  if (!wakeupThreshold)
+    return ESP_OK;
+  wakeupThreshold = 0;
+
+  LockGuard lgWakeup(wakeupMutex);
+  if (!(wakeupPorts & (1 << port)))
+    return ESP_OK;
+  wakeupPorts &= ~(1 << port);
+  // ESP_ERR_INVALID_STATE means that the UART wakeup is already disabled
+  esp_err_t error = esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_UART);
+  ESP_RETURN_ON_FALSE(error == ESP_OK || error == ESP_ERR_INVALID_STATE, error, TAG, "disable sleep wakeup failed");
+  for (int otherPort = 0; otherPort < UART_NUM_MAX; otherPort++) {
+    if (wakeupPorts & (1 << otherPort)) {
+      ESP_RETURN_ON_ERROR(esp_sleep_enable_uart_wakeup(otherPort), TAG, "enable sleep wakeup failed");
+    }
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::PrepareForLightSleep(TickType_t timeout) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(initialized, ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
+  if (uart_is_driver_installed(port)) {
+    ESP_RETURN_ON_ERROR(uart_wait_tx_done(port, timeout), TAG, "wait TX done failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::ResumeFromLightSleep(esp_sleep_wakeup_cause_t wakeupCause) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(initialized, ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
+  // Preamble bytes are discarded lazily by the next read so that resuming does not wait for the preamble to end
+  if (wakeupThreshold && wakeupPreamble == UartWakeupPreamble::discard && wakeupCause == ESP_SLEEP_WAKEUP_UART) {
+    LockGuard lgRx(rxMutex);
+    discardingWakeupPreamble = true;
+  }
   return ESP_OK;
 }
 
@@ -141,24 +274,44 @@ esp_err_t Uart::Read(void* dest, size_t size) {
   ESP_RETURN_ON_FALSE(enabled, ESP_ERR_INVALID_STATE, TAG, "uart port is not enabled");
   if (!size)
     return ESP_OK;
+
+  // The preamble discarding and the data reading share the read timeout
+  TickType_t startTick = xTaskGetTickCount();
+  ESP_RETURN_ON_ERROR(DiscardWakeupPreamble(readTimeout), TAG, "discard wakeup preamble failed");
+  {
+    LockGuard lgRx(rxMutex);
+    size -= TakeRxBacklog(dest, size);
+  }
+  if (!size)
+    return ESP_OK;
+
+  if (rxTaskHandle) {
+    // The RX task reads the received data into the backlog
+    while (true) {
+      {
+        LockGuard lgRx(rxMutex);
+        size -= TakeRxBacklog(dest, size);
+      }
+      if (!size)
+        return ESP_OK;
+      TickType_t remainingTime = GetRemainingTime(startTick, readTimeout);
+      ESP_RETURN_ON_FALSE(remainingTime && xSemaphoreTake(rxSemaphore, remainingTime) == pdTRUE, ESP_ERR_TIMEOUT, TAG, "timeout");
+    }
+  }
   
   int res = 0;
   if (dest) {
-    res = uart_read_bytes(port, dest, size, readTimeout);
+    res = uart_read_bytes(port, dest, size, GetRemainingTime(startTick, readTimeout));
     if (res > 0)
       size -= res;
   }
   else {
     constexpr size_t discardBufferSize = 64;
     uint8_t discardBuffer[discardBufferSize];
-    TickType_t startTick = xTaskGetTickCount();
-    TickType_t elapsedTicks = 0;
     do {
-      res = uart_read_bytes(port, discardBuffer, std::min(size, discardBufferSize), elapsedTicks < readTimeout ? readTimeout - elapsedTicks : 0);
-      if (res > 0) {
+      res = uart_read_bytes(port, discardBuffer, std::min(size, discardBufferSize), GetRemainingTime(startTick, readTimeout));
+      if (res > 0)
         size -= res;
-        elapsedTicks = xTaskGetTickCount() - startTick;
-      }
     } while (size && res > 0);
   }
   ESP_RETURN_ON_FALSE(res >= 0, ESP_FAIL, TAG, "read bytes failed");
@@ -169,12 +322,232 @@ esp_err_t Uart::Read(void* dest, size_t size) {
 //==============================================================================
 
 esp_err_t Uart::Write(const void* src, size_t size) {
+  return Write(src, size, UartTxPriority::normal);
+}
+
+//==============================================================================
+
+esp_err_t Uart::Write(const void* src, size_t size, UartTxPriority priority) {
+  return WriteFrame(src, size, priority, NULL);
+}
+
+//==============================================================================
+
+UartReadOperation Uart::ReadAsync(void* dest, size_t size) {
+  LockGuard lg(*this);
+  esp_err_t error = enabled ? ESP_OK : ESP_ERR_INVALID_STATE;
+  if (error == ESP_OK && !asyncRx) {
+    asyncRx = true;
+    error = ConfigureRxTask();
+  }
+  return UartReadOperation(*this, dest, size, NULL, readTimeout, error);
+}
+
+//==============================================================================
+
+UartReadOperation Uart::ReadFrameAsync(std::vector<uint8_t>& frame) {
+  LockGuard lg(*this);
+  esp_err_t error = enabled ? ESP_OK : ESP_ERR_INVALID_STATE;
+  if (error == ESP_OK && rxFraming == UartRxFraming::none)
+    error = ESP_ERR_INVALID_STATE;
+  return UartReadOperation(*this, NULL, 0, &frame, readTimeout, error);
+}
+
+//==============================================================================
+
+UartWriteOperation Uart::WriteAsync(const void* src, size_t size, UartTxPriority priority) {
+  LockGuard lg(*this);
+  // The frames are transmitted by the TX priority queue task, so that the scheduler task is never blocked by the transmission.
+  // The queue is not enabled implicitly since it changes the ordering of the other writes (the write fails without it).
+  esp_err_t error = enabled ? ESP_OK : ESP_ERR_INVALID_STATE;
+  return UartWriteOperation(*this, src, size, priority, error);
+}
+
+//==============================================================================
+
+esp_err_t Uart::WriteFrame(const void* src, size_t size, UartTxPriority priority, UartAsyncOperation* operation) {
+  int lane = (int)priority;
+  ESP_RETURN_ON_FALSE(lane >= 0 && lane < numberOfTxPriorities, ESP_ERR_INVALID_ARG, TAG, "invalid priority (%d)", lane);
+  
+  // Wait for the lane to drain to the TX buffer size without holding the port lock
+  // so that the higher priority frames are not blocked by the lower priority ones.
+  // Asynchronous frames are not copied to the lane, so they do not wait.
+  size_t maxLaneSize = std::max(txBufferSize, minBufferSize);
+  while (!operation) {
+    {
+      LockGuard lg(txQueueMutex);
+      if (!txQueueEnabled || !txQueueSize[lane] || txQueueSize[lane] + size <= maxLaneSize)
+        break;
+      xEventGroupClearBits(taskEvents, txFrameDequeuedBit);
+    }
+    // The TX task sets the bit whenever it takes a frame from the queue
+    xEventGroupWaitBits(taskEvents, txFrameDequeuedBit, pdFALSE, pdFALSE, portMAX_DELAY);
+  }
+
   LockGuard lg(*this);
   ESP_RETURN_ON_FALSE(enabled, ESP_ERR_INVALID_STATE, TAG, "uart port is not enabled");
   if (!size)
     return ESP_OK;
   ESP_RETURN_ON_FALSE(src, ESP_ERR_INVALID_ARG, TAG, "src is null");
-  ESP_RETURN_ON_FALSE(uart_write_bytes(port, src, size) == size, ESP_FAIL, TAG, "write bytes failed");
+  
+  {
+    LockGuard lgTxQueue(txQueueMutex);
+    if (txQueueEnabled) {
+      TxFrame frame = {{}, src, size, 0, 0, operation, txSequenceNumber++};
+      if (!operation) {
+        frame.data.assign((const uint8_t*)src, (const uint8_t*)src + size);
+        frame.src = frame.data.data();
+      }
+      txQueueSize[lane] += frame.data.size();
+      txQueue[lane].push_back(std::move(frame));
+      xTaskNotifyGive(txTaskHandle);
+    }
+    else {
+      ESP_RETURN_ON_FALSE(!operation, ESP_ERR_INVALID_STATE, TAG, "TX priority queue is not enabled");
+      RecordTxChunk(src, size, 0, 0);
+      ESP_RETURN_ON_FALSE(uart_write_bytes(port, src, size) == size, ESP_FAIL, TAG, "write bytes failed");
+    }
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::SendBreak(uint32_t duration, uint32_t markDuration) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(enabled, ESP_ERR_INVALID_STATE, TAG, "uart port is not enabled");
+  ESP_RETURN_ON_FALSE(duration, ESP_ERR_INVALID_ARG, TAG, "invalid break duration");
+  {
+    LockGuard lgTxQueue(txQueueMutex);
+    if (txQueueEnabled) {
+      // The break is an ordering barrier for all the lanes
+      txBreakQueue.push_back({{}, NULL, 0, duration, markDuration, NULL, txSequenceNumber++});
+      xTaskNotifyGive(txTaskHandle);
+      return ESP_OK;
+    }
+  }
+  ESP_RETURN_ON_ERROR(uart_wait_tx_done(port, portMAX_DELAY), TAG, "wait TX done failed");
+  {
+    LockGuard lgTxQueue(txQueueMutex);
+    RecordTxChunk(NULL, 0, duration, markDuration);
+  }
+  ESP_RETURN_ON_ERROR(GenerateBreak(duration, markDuration), TAG, "generate break failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+UartRxFraming Uart::GetRxFraming() {
+  LockGuard lg(*this);
+  return rxFraming;
+}
+
+//==============================================================================
+
+esp_err_t Uart::SetRxFraming(UartRxFraming framing) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(framing == UartRxFraming::none || framing == UartRxFraming::breakDelimited || framing == UartRxFraming::idleDelimited,
+                      ESP_ERR_INVALID_ARG, TAG, "invalid RX framing (%d)", (int)framing);
+  {
+    LockGuard lgRx(rxMutex);
+    rxFraming = framing;
+    rxFrameSizes.clear();
+    rxFramedSize = 0;
+    rxBreakPending = false;
+    rxFrameFiltered = false;
+    rxFrameDropped = false;
+    if (framing == UartRxFraming::none)
+      addressFilterEnabled = false;
+  }
+  if (uart_is_driver_installed(port)) {
+    ESP_RETURN_ON_ERROR(ConfigureInterrupts(), TAG, "configure interrupts failed");
+    ESP_RETURN_ON_ERROR(ConfigureRxTask(), TAG, "configure RX task failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::EnableAddressFilter(uint8_t address, int broadcastAddress) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(rxFraming != UartRxFraming::none, ESP_ERR_INVALID_STATE, TAG, "RX framing is not enabled");
+  ESP_RETURN_ON_FALSE(broadcastAddress == noBroadcastAddress || (broadcastAddress >= 0 && broadcastAddress <= UINT8_MAX), ESP_ERR_INVALID_ARG, TAG,
+                      "invalid broadcast address (%d)", broadcastAddress);
+  LockGuard lgRx(rxMutex);
+  addressFilterEnabled = true;
+  filterAddress = address;
+  filterBroadcastAddress = broadcastAddress;
+  rxFrameFiltered = false;
+  rxFrameDropped = false;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::DisableAddressFilter() {
+  LockGuard lg(*this);
+  LockGuard lgRx(rxMutex);
+  addressFilterEnabled = false;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::ReadFrame(std::vector<uint8_t>& frame) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(enabled, ESP_ERR_INVALID_STATE, TAG, "uart port is not enabled");
+  ESP_RETURN_ON_FALSE(rxFraming != UartRxFraming::none, ESP_ERR_INVALID_STATE, TAG, "RX framing is not enabled");
+  
+  TickType_t startTick = xTaskGetTickCount();
+  while (true) {
+    {
+      LockGuard lgRx(rxMutex);
+      if (rxFrameSizes.size()) {
+        frame.resize(rxFrameSizes.front());
+        void* dest = frame.data();
+        TakeRxBacklog(dest, frame.size());
+        return ESP_OK;
+      }
+    }
+    TickType_t remainingTime = GetRemainingTime(startTick, readTimeout);
+    ESP_RETURN_ON_FALSE(remainingTime && xSemaphoreTake(rxSemaphore, remainingTime) == pdTRUE, ESP_ERR_TIMEOUT, TAG, "timeout");
+  }
+}
+
+//==============================================================================
+
+esp_err_t Uart::EnableTxPriorityQueue(UBaseType_t taskPriority) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(initialized, ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
+  LockGuard lgTxQueue(txQueueMutex);
+  if (txQueueEnabled)
+    return ESP_OK;
+  txTaskPriority = taskPriority;
+  ESP_RETURN_ON_FALSE(!txTaskHandle, ESP_ERR_INVALID_STATE, TAG, "TX task is still running");
+  ESP_RETURN_ON_FALSE(xTaskCreate(TxTask, "pl_uart_tx", txTaskStackSize, this, taskPriority, &txTaskHandle) == pdPASS,
+                      ESP_FAIL, TAG, "TX task create failed");
+  txQueueEnabled = true;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::DisableTxPriorityQueue() {
+  // The port lock is held until the queue is transmitted, so the writers and the breaks that go directly
+  // to the driver cannot get ahead of the queued frames (the TX task never takes the port lock)
+  LockGuard lg(*this);
+  {
+    LockGuard lgTxQueue(txQueueMutex);
+    if (!txQueueEnabled)
+      return ESP_OK;
+    txQueueEnabled = false;
+    // The writers waiting for the lanes to drain write directly to the driver once the queue is transmitted
+    xEventGroupClearBits(taskEvents, txTaskExitedBit);
+    xEventGroupSetBits(taskEvents, txFrameDequeuedBit);
+    xTaskNotifyGive(txTaskHandle);
+  }
+  // The TX task sets the bit when the queue is transmitted
+  xEventGroupWaitBits(taskEvents, txTaskExitedBit, pdFALSE, pdFALSE, portMAX_DELAY);
   return ESP_OK;
 }
 
@@ -191,8 +564,12 @@ size_t Uart::GetReadableSize() {
   LockGuard lg(*this);
   if (!enabled)
     return 0;
+  DiscardWakeupPreamble(0);
+  LockGuard lgRx(rxMutex);
+  if (rxTaskHandle)
+    return GetReadableBacklogSize();
   size_t size = 0;
-  return uart_get_buffered_data_len(port, &size) == ESP_OK ? size : 0;
+  return rxBacklogSize + (uart_get_buffered_data_len(port, &size) == ESP_OK ? size : 0);
 }
 
 //==============================================================================
@@ -318,9 +695,96 @@ esp_err_t Uart::SetFlowControl(UartFlowControl flowControl) {
 
 esp_err_t Uart::SetMode(uart_mode_t mode) {
   LockGuard lg(*this);
-  ESP_RETURN_ON_FALSE(uart_is_driver_installed(port), ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
+  ESP_RETURN_ON_FALSE(initialized, ESP_ERR_INVALID_STATE, TAG, "uart port is not initialized");
   this->mode = mode;
-  ESP_RETURN_ON_ERROR(uart_set_mode(port, mode), TAG, "set mode failed");
+  if (uart_is_driver_installed(port)) {
+    ESP_RETURN_ON_ERROR(uart_set_mode(port, mode), TAG, "set mode failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+int Uart::GetRxBufferSize() {
+  LockGuard lg(*this);
+  return rxBufferSize;
+}
+
+//==============================================================================
+
+esp_err_t Uart::SetRxBufferSize(int size) {
+  LockGuard lg(*this);
+  size = std::max((size + 3) / 4 * 4, minBufferSize);
+  if (size == rxBufferSize)
+    return ESP_OK;
+  rxBufferSize = size;
+  ESP_RETURN_ON_ERROR(ReinstallDriver(), TAG, "reinstall driver failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+int Uart::GetTxBufferSize() {
+  LockGuard lg(*this);
+  return txBufferSize;
+}
+
+//==============================================================================
+
+esp_err_t Uart::SetTxBufferSize(int size) {
+  LockGuard lg(*this);
+  size = size == 0 ? 0 : std::max((size + 3) / 4 * 4, minBufferSize);
+  if (size == txBufferSize)
+    return ESP_OK;
+  txBufferSize = size;
+  ESP_RETURN_ON_ERROR(ReinstallDriver(), TAG, "reinstall driver failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::Replay(const UartTraffic& traffic, float speed) {
+  {
+    LockGuard lg(*this);
+    ESP_RETURN_ON_FALSE(enabled, ESP_ERR_INVALID_STATE, TAG, "uart port is not enabled");
+  }
+  ESP_RETURN_ON_FALSE(speed >= 0, ESP_ERR_INVALID_ARG, TAG, "invalid speed");
+
+  // The lock is not held between the chunks so that the port can be used concurrently. Chunks are written
+  // as normal priority frames, so they do not interleave with the TX priority queue output or the breaks.
+  // Chunk times are accumulated from the start so that the timing errors do not compound.
+  SleepTimer sleepTimer;
+  ESP_RETURN_ON_FALSE(sleepTimer.IsCreated(), ESP_ERR_NO_MEM, TAG, "sleep timer create failed");
+  int64_t time = esp_timer_get_time();
+  for (auto& chunk : traffic) {
+    if (speed) {
+      time += (int64_t)(chunk.delay / (double)speed);
+      sleepTimer.SleepUntil(time);
+    }
+    ESP_RETURN_ON_ERROR(Write(chunk.data.data(), chunk.data.size()), TAG, "write failed");
+    if (chunk.breakDuration)
+      ESP_RETURN_ON_ERROR(SendBreak(chunk.breakDuration, chunk.markDuration), TAG, "send break failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::StartTxRecording(std::shared_ptr<UartTraffic> traffic) {
+  LockGuard lg(*this);
+  ESP_RETURN_ON_FALSE(traffic, ESP_ERR_INVALID_ARG, TAG, "traffic is null");
+  LockGuard lgTxQueue(txQueueMutex);
+  txRecording = traffic;
+  txRecordingTime = esp_timer_get_time();
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::StopTxRecording() {
+  LockGuard lg(*this);
+  LockGuard lgTxQueue(txQueueMutex);
+  txRecording = nullptr;
   return ESP_OK;
 }
 
@@ -348,11 +812,25 @@ esp_err_t Uart::ConfigureInterrupts() {
   // Otherwise small read timeouts are not possible since uart_get_buffered_data_len does not show new data
   // for a long time while it's still in FIFO.
 
+  // With the idle-delimited RX framing the RX timeout threshold is the frame idle time.
+  // With the break-delimited RX framing the short RX timeout delivers the data received before a break together with the null byte
+  // the break puts into the RX FIFO right after the break event, so the RX task can place the frame boundary at that byte.
+
   uint8_t rxThreshold = std::max((uint32_t)1, std::min((uint32_t)maxRxFifoFullThreshold, baudRate * portTICK_PERIOD_MS / 8 / 1000 / 2));
   
   uart_intr_config_t config = {};
   config.intr_enable_mask = UART_INTR_CONFIG_FLAG;
-  config.rx_timeout_thresh = rxThreshold;
+  switch (rxFraming) {
+    case UartRxFraming::breakDelimited:
+      config.rx_timeout_thresh = rxBreakFlushTime;
+      break;
+    case UartRxFraming::idleDelimited:
+      config.rx_timeout_thresh = rxFrameIdleTime;
+      break;
+    default:
+      config.rx_timeout_thresh = rxThreshold;
+      break;
+  }
   config.txfifo_empty_intr_thresh = defaultTxFifoEmptyThreshold;
   config.rxfifo_full_thresh = rxThreshold;
   ESP_RETURN_ON_ERROR(uart_intr_config(port, &config), TAG, "interrupt configuration failed");
@@ -361,4 +839,548 @@ esp_err_t Uart::ConfigureInterrupts() {
 
 //==============================================================================
 
+esp_err_t Uart::InstallDriver() {
+  ESP_RETURN_ON_ERROR(uart_driver_install(port, rxBufferSize, txBufferSize, rxEventQueueSize, &rxEventQueue, 0), TAG, "driver install failed");
+  ESP_RETURN_ON_ERROR(ConfigureInterrupts(), TAG, "configure interrupts failed");
+  ESP_RETURN_ON_ERROR(uart_set_mode(port, mode), TAG, "set mode failed");
+  ESP_RETURN_ON_ERROR(uart_set_loop_back(port, loopbackEnabled), TAG, "set loopback failed");
+  if (wakeupThreshold) {
+    ESP_RETURN_ON_ERROR(ConfigureWakeup(), TAG, "configure wakeup failed");
+  }
+  ESP_RETURN_ON_ERROR(ConfigureRxTask(), TAG, "configure RX task failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::ReinstallDriver() {
+  if (!uart_is_driver_installed(port))
+    return ESP_OK;
+
+  // Queued and buffered TX data is transmitted and the RX data left in the driver is moved to the backlog
+  // so that no data is lost when the driver buffers are reallocated
+  bool txQueueWasEnabled;
+  {
+    LockGuard lgTxQueue(txQueueMutex);
+    txQueueWasEnabled = txQueueEnabled;
+  }
+  ESP_RETURN_ON_ERROR(DisableTxPriorityQueue(), TAG, "disable TX priority queue failed");
+  ESP_RETURN_ON_ERROR(uart_wait_tx_done(port, portMAX_DELAY), TAG, "wait TX done failed");
+  // The pending asynchronous read is kept for the new RX task
+  ESP_RETURN_ON_ERROR(StopRxTask(true), TAG, "stop RX task failed");
+  {
+    LockGuard lgRx(rxMutex);
+    MoveDriverRxData();
+  }
+  ESP_RETURN_ON_ERROR(uart_driver_delete(port), TAG, "driver delete failed");
+  ESP_RETURN_ON_ERROR(InstallDriver(), TAG, "install driver failed");
+  UartReadOperation* completedOperation = NULL;
+  {
+    // The pending asynchronous read can complete with the data moved from the driver
+    LockGuard lgRx(rxMutex);
+    if (rxOperation && rxOperation->TryComplete())
+      completedOperation = ReleaseRxOperation();
+  }
+  if (completedOperation)
+    completedOperation->Complete(ESP_OK);
+  if (txQueueWasEnabled) {
+    ESP_RETURN_ON_ERROR(EnableTxPriorityQueue(txTaskPriority), TAG, "enable TX priority queue failed");
+  }
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::ConfigureWakeup() {
+  ESP_RETURN_ON_ERROR(uart_set_wakeup_threshold(port, wakeupThreshold), TAG, "set wakeup threshold failed");
+  LockGuard lgWakeup(wakeupMutex);
+  ESP_RETURN_ON_ERROR(esp_sleep_enable_uart_wakeup(port), TAG, "enable sleep wakeup failed");
+  wakeupPorts |= 1 << port;
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::DiscardWakeupPreamble(TickType_t timeout) {
+  // With the RX task running the preamble is discarded when the data is fetched
+  LockGuard lgRx(rxMutex);
+  if (rxTaskHandle || !discardingWakeupPreamble || rxBacklogSize)
+    return ESP_OK;
+  
+  uint8_t dataByte;
+  TickType_t startTick = xTaskGetTickCount();
+  int res;
+  while ((res = uart_read_bytes(port, &dataByte, 1, GetRemainingTime(startTick, timeout))) > 0) {
+    if (dataByte != wakeupPreambleByte) {
+      discardingWakeupPreamble = false;
+      ResizeRxBacklog(rxBacklogSize + 1);
+      StoreRxData(&dataByte, 1);
+      break;
+    }
+  }
+  ESP_RETURN_ON_FALSE(res >= 0, ESP_FAIL, TAG, "read bytes failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::ConfigureRxTask() {
+  if (rxFraming == UartRxFraming::none && !asyncRx)
+    return StopRxTask();
+  if (rxTaskHandle)
+    return ESP_OK;
+  {
+    // The data received before the task start is moved to the backlog first,
+    // so the queued events do not refer to the data that is no longer in the driver
+    LockGuard lgRx(rxMutex);
+    ResizeRxBacklog(rxBufferSize);
+    MoveDriverRxData();
+    xQueueReset(rxEventQueue);
+  }
+  ESP_RETURN_ON_FALSE(xTaskCreate(RxTask, "pl_uart_rx", rxTaskStackSize, this, rxTaskPriority, &rxTaskHandle) == pdPASS,
+                      ESP_FAIL, TAG, "RX task create failed");
+  return ESP_OK;
+}
+
+//==============================================================================
+
+esp_err_t Uart::StopRxTask(bool keepOperation) {
+  if (!rxTaskHandle)
+    return ESP_OK;
+  uart_event_t event = {};
+  event.type = rxTaskStopEvent;
+  xEventGroupClearBits(taskEvents, rxTaskExitedBit);
+  ESP_RETURN_ON_FALSE(xQueueSend(rxEventQueue, &event, portMAX_DELAY) == pdTRUE, ESP_FAIL, TAG, "RX task stop failed");
+  // The RX task sets the bit before exiting
+  xEventGroupWaitBits(taskEvents, rxTaskExitedBit, pdFALSE, pdFALSE, portMAX_DELAY);
+  UartReadOperation* abortedOperation = NULL;
+  {
+    // The rest of the received data is read from the driver after the backlog
+    LockGuard lgRx(rxMutex);
+    ResizeRxBacklog(0);
+    if (!keepOperation)
+      abortedOperation = ReleaseRxOperation();
+  }
+  if (abortedOperation)
+    abortedOperation->Complete(ESP_ERR_INVALID_STATE);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+UartReadOperation* Uart::ReleaseRxOperation() {
+  // Called with the RX mutex locked
+  UartReadOperation* operation = rxOperation;
+  rxOperation = NULL;
+  esp_timer_stop(rxTimeoutTimer);
+  return operation;
+}
+
+//==============================================================================
+
+void Uart::ReceiveRxData(size_t size) {
+  // Called with the RX mutex locked. Exactly the data of one driver event is read,
+  // so that the frame boundaries of the following events are placed correctly.
+  if (!size)
+    return;
+  if (rxBreakPending) {
+    ReceiveBreakData(size);
+    return;
+  }
+  constexpr size_t receiveBufferSize = 64;
+  uint8_t receiveBuffer[receiveBufferSize];
+  while (size) {
+    int res = uart_read_bytes(port, receiveBuffer, std::min(size, receiveBufferSize), 0);
+    if (res <= 0)
+      return;
+    size -= res;
+    AddRxData(receiveBuffer, res);
+  }
+}
+
+//==============================================================================
+
+void Uart::ReceiveBreakData(size_t size) {
+  // Called with the RX mutex locked for the first data after a break. The break puts a null byte into the RX FIFO after
+  // the data received before it, and the short RX timeout delivers them with the first data event after the break event.
+  // The frame ends at that null byte, which is not stored.
+  rxBreakPending = false;
+  uint8_t breakData[SOC_UART_FIFO_LEN];
+  int res = size <= sizeof(breakData) ? uart_read_bytes(port, breakData, size, 0) : 0;
+  if (res > 0 && !breakData[res - 1]) {
+    AddRxData(breakData, res - 1);
+    EndRxFrame();
+    return;
+  }
+
+  // Otherwise the null byte has been delivered before the break event, so the frame ends before the data
+  if (rxBacklogSize > rxFramedSize && !rxBacklog[(rxBacklogStart + rxBacklogSize - 1) % rxBacklog.size()])
+    rxBacklogSize--;
+  EndRxFrame();
+  if (res > 0) {
+    AddRxData(breakData, res);
+    size -= res;
+  }
+  ReceiveRxData(size);
+}
+
+//==============================================================================
+
+void Uart::AddRxData(const uint8_t* src, size_t size) {
+  // Called with the RX mutex locked
+  while (discardingWakeupPreamble && size && *src == wakeupPreambleByte) {
+    src++;
+    size--;
+  }
+  if (size)
+    discardingWakeupPreamble = false;
+  StoreRxData(src, size);
+}
+
+//==============================================================================
+
+void Uart::MoveDriverRxData() {
+  // Called with the RX mutex locked and the RX task stopped
+  size_t size = 0;
+  if (uart_get_buffered_data_len(port, &size) != ESP_OK || !size)
+    return;
+  ResizeRxBacklog(rxBacklogSize + size);
+  ReceiveRxData(size);
+}
+
+//==============================================================================
+
+void Uart::StoreRxData(const uint8_t* src, size_t size) {
+  // Called with the RX mutex locked. The frame that does not start with the filter address or
+  // does not fit into the backlog is dropped until the end of the frame.
+  if (!size)
+    return;
+  if (addressFilterEnabled && !rxFrameFiltered) {
+    rxFrameDropped = src[0] != filterAddress && src[0] != filterBroadcastAddress;
+    rxFrameFiltered = true;
+  }
+  if (rxFrameDropped)
+    return;
+  if (rxBacklogSize + size > rxBacklog.size()) {
+    if (rxFraming != UartRxFraming::none) {
+      DropRxFrame();
+      return;
+    }
+    size = rxBacklog.size() - rxBacklogSize;
+  }
+
+  size_t end = (rxBacklogStart + rxBacklogSize) % std::max(rxBacklog.size(), (size_t)1);
+  size_t firstSize = std::min(size, rxBacklog.size() - end);
+  std::copy_n(src, firstSize, rxBacklog.data() + end);
+  std::copy_n(src + firstSize, size - firstSize, rxBacklog.data());
+  rxBacklogSize += size;
 }
+
+//==============================================================================
+
+void Uart::DropRxFrame() {
+  // Called with the RX mutex locked
+  rxBacklogSize = std::min(rxBacklogSize, rxFramedSize);
+  rxFrameDropped = true;
+}
+
+//==============================================================================
+
+void Uart::EndRxFrame() {
+  // Called with the RX mutex locked
+  if (rxBacklogSize > rxFramedSize) {
+    rxFrameSizes.push_back(rxBacklogSize - rxFramedSize);
+    rxFramedSize = rxBacklogSize;
+  }
+  rxFrameFiltered = false;
+  rxFrameDropped = false;
+}
+
+//==============================================================================
+
+size_t Uart::GetReadableBacklogSize() {
+  // Called with the RX mutex locked. With the address filter enabled only the accepted complete frames can be read.
+  return addressFilterEnabled ? rxFramedSize : rxBacklogSize;
+}
+
+//==============================================================================
+
+size_t Uart::TakeRxBacklog(void*& dest, size_t size) {
+  // Called with the RX mutex locked
+  size = std::min(size, GetReadableBacklogSize());
+  if (dest) {
+    CopyRxBacklog((uint8_t*)dest, size);
+    dest = (uint8_t*)dest + size;
+  }
+  rxBacklogStart = rxBacklogSize > size ? (rxBacklogStart + size) % rxBacklog.size() : 0;
+  rxBacklogSize -= size;
+
+  for (size_t remainingSize = size; remainingSize && rxFrameSizes.size();) {
+    size_t frameSize = std::min(remainingSize, rxFrameSizes.front());
+    rxFrameSizes.front() -= frameSize;
+    rxFramedSize -= frameSize;
+    remainingSize -= frameSize;
+    if (!rxFrameSizes.front())
+      rxFrameSizes.pop_front();
+  }
+
+  // Without the RX task the backlog only holds the data left by the driver reinstallation or the wakeup preamble discarding
+  if (!rxTaskHandle && !rxBacklogSize)
+    ResizeRxBacklog(0);
+  return size;
+}
+
+//==============================================================================
+
+void Uart::ResizeRxBacklog(size_t capacity) {
+  // Called with the RX mutex locked. The backlog is a ring buffer that is never smaller than the data it holds.
+  capacity = std::max(capacity, rxBacklogSize);
+  if (capacity == rxBacklog.size())
+    return;
+  std::vector<uint8_t> backlog(capacity);
+  CopyRxBacklog(backlog.data(), rxBacklogSize);
+  rxBacklog.swap(backlog);
+  rxBacklogStart = 0;
+}
+
+//==============================================================================
+
+void Uart::CopyRxBacklog(uint8_t* dest, size_t size) {
+  // Called with the RX mutex locked
+  size_t firstSize = std::min(size, rxBacklog.size() - rxBacklogStart);
+  std::copy_n(rxBacklog.data() + rxBacklogStart, firstSize, dest);
+  std::copy_n(rxBacklog.data(), size - firstSize, dest + firstSize);
+}
+
+//==============================================================================
+
+esp_err_t Uart::GenerateBreak(uint32_t duration, uint32_t markDuration) {
+  // The break is generated by inverting the idle TX line, which does not require changing the baud rate
+  int64_t time = esp_timer_get_time() + duration;
+  ESP_RETURN_ON_ERROR(uart_set_line_inverse(port, UART_SIGNAL_TXD_INV), TAG, "set line inverse failed");
+  WaitUntil(time);
+  ESP_RETURN_ON_ERROR(uart_set_line_inverse(port, UART_SIGNAL_INV_DISABLE), TAG, "set line inverse failed");
+  WaitUntil(time + markDuration);
+  return ESP_OK;
+}
+
+//==============================================================================
+
+void Uart::RecordTxChunk(const void* src, size_t size, uint32_t breakDuration, uint32_t markDuration) {
+  // Called with the TX queue mutex locked (the TX task records without the port lock)
+  if (!txRecording)
+    return;
+  int64_t time = esp_timer_get_time();
+  txRecording->push_back({(uint64_t)(time - txRecordingTime), std::vector<uint8_t>((const uint8_t*)src, (const uint8_t*)src + size),
+                          breakDuration, markDuration});
+  txRecordingTime = time;
+}
+
+//==============================================================================
+
+void Uart::RxTask(void* parameters) {
+  Uart& uart = *(Uart*)parameters;
+  uart_event_t event;
+  while (true) {
+    // The asynchronous read timeout is handled by the timer, so only the driver events and the stop event are queued
+    if (xQueueReceive(uart.rxEventQueue, &event, portMAX_DELAY) != pdTRUE)
+      continue;
+    if (event.type == rxTaskStopEvent)
+      break;
+    bool dataReceived = event.type == UART_DATA || event.type == UART_BUFFER_FULL;
+    bool breakReceived = event.type == UART_BREAK;
+    bool idleReceived = dataReceived && event.timeout_flag;
+    bool overflowReceived = event.type == UART_FIFO_OVF;
+    
+    UartReadOperation* completedOperation = NULL;
+    bool readableDataReceived;
+    {
+      LockGuard lg(uart.rxMutex);
+      size_t readableSize = uart.GetReadableBacklogSize();
+      // The data is consumed per event (the data of a full driver buffer event is read when the buffer has space),
+      // so the frame boundaries are placed between the data of the events that precede and follow them
+      if (dataReceived)
+        uart.ReceiveRxData(event.size);
+      if (overflowReceived && uart.rxFraming != UartRxFraming::none)
+        uart.DropRxFrame();
+      // The frame before the break ends at the null byte of the break that is delivered after the break event
+      if (breakReceived && uart.rxFraming == UartRxFraming::breakDelimited)
+        uart.rxBreakPending = true;
+      if (idleReceived && uart.rxFraming == UartRxFraming::idleDelimited)
+        uart.EndRxFrame();
+      // The data of the events lost to the event queue overflow stays in the driver. It is read once no events are pending,
+      // so the event sizes and the driver buffer cannot get out of step.
+      size_t bufferedSize = 0;
+      if (!uxQueueMessagesWaiting(uart.rxEventQueue) && uart_get_buffered_data_len(uart.port, &bufferedSize) == ESP_OK)
+        uart.ReceiveRxData(bufferedSize);
+      // Readers are not woken up by the data that cannot be read yet (e.g. frames dropped by the address filter)
+      readableDataReceived = uart.GetReadableBacklogSize() > readableSize;
+      if (uart.rxOperation && uart.rxOperation->TryComplete())
+        completedOperation = uart.ReleaseRxOperation();
+    }
+    if (readableDataReceived)
+      xSemaphoreGive(uart.rxSemaphore);
+    // The coroutine is scheduled without the RX mutex locked since it locks the mutex when resumed
+    if (completedOperation)
+      completedOperation->Complete(ESP_OK);
+    if (breakReceived)
+      uart.breakEvent.Generate();
+  }
+
+  {
+    LockGuard lg(uart.rxMutex);
+    uart.rxTaskHandle = NULL;
+  }
+  xEventGroupSetBits(uart.taskEvents, rxTaskExitedBit);
+  vTaskDelete(NULL);
+}
+
+//==============================================================================
+
+void Uart::RxTimeoutCallback(void* parameters) {
+  Uart& uart = *(Uart*)parameters;
+  UartReadOperation* timedOutOperation = NULL;
+  {
+    // The operation that replaced the timed out one while the callback was waiting for the mutex is not timed out,
+    // the timer is restarted for the rest of its timeout instead (the restart fails if its own timer is running)
+    LockGuard lg(uart.rxMutex);
+    if (uart.rxOperation) {
+      TickType_t remainingTime = GetRemainingTime(uart.rxOperation->startTick, uart.rxOperation->timeout);
+      if (!remainingTime)
+        timedOutOperation = uart.ReleaseRxOperation();
+      else if (remainingTime != portMAX_DELAY)
+        esp_timer_start_once(uart.rxTimeoutTimer, (uint64_t)remainingTime * portTICK_PERIOD_MS * 1000);
+    }
+  }
+  if (timedOutOperation)
+    timedOutOperation->Complete(ESP_ERR_TIMEOUT);
+}
+
+//==============================================================================
+
+void Uart::TxTask(void* parameters) {
+  Uart& uart = *(Uart*)parameters;
+  while (true) {
+    TxFrame frame;
+    bool frameSelected = false;
+    {
+      LockGuard lg(uart.txQueueMutex);
+      // The frames written after the next break wait until the break is sent
+      auto isFrameBeforeBreak = [&uart](const TxFrame& frame) {
+        return uart.txBreakQueue.empty() || (int32_t)(frame.sequenceNumber - uart.txBreakQueue.front().sequenceNumber) < 0;
+      };
+      int lane = numberOfTxPriorities - 1;
+      while (lane >= 0 && (uart.txQueue[lane].empty() || !isFrameBeforeBreak(uart.txQueue[lane].front())))
+        lane--;
+      if (lane >= 0) {
+        frame = std::move(uart.txQueue[lane].front());
+        uart.txQueue[lane].pop_front();
+        uart.txQueueSize[lane] -= frame.data.size();
+        frameSelected = true;
+        xEventGroupSetBits(uart.taskEvents, txFrameDequeuedBit);
+      }
+      else if (!uart.txBreakQueue.empty()) {
+        frame = std::move(uart.txBreakQueue.front());
+        uart.txBreakQueue.pop_front();
+        frameSelected = true;
+      }
+      // The queued frames and breaks are recorded in the order they are sent
+      if (frameSelected)
+        uart.RecordTxChunk(frame.src, frame.size, frame.breakDuration, frame.markDuration);
+      else if (!uart.txQueueEnabled) {
+        uart.txTaskHandle = NULL;
+        xEventGroupSetBits(uart.taskEvents, txTaskExitedBit);
+        break;
+      }
+    }
+    
+    if (!frameSelected) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    // The frame is transmitted completely before the next one is selected so that
+    // the driver TX buffer never holds more than one frame ahead of a higher priority one
+    esp_err_t result = ESP_OK;
+    if (frame.size) {
+      if (uart_write_bytes(uart.port, frame.src, frame.size) != frame.size) {
+        ESP_LOGE(TAG, "write bytes failed");
+        result = ESP_FAIL;
+      }
+      uart_wait_tx_done(uart.port, portMAX_DELAY);
+    }
+    if (frame.breakDuration)
+      uart.GenerateBreak(frame.breakDuration, frame.markDuration);
+    if (frame.operation)
+      frame.operation->Complete(result);
+  }
+  vTaskDelete(NULL);
+}
+
+//==============================================================================
+
+static void WaitUntil(int64_t time) {
+  // Busy-wait for the microsecond timing of the breaks
+  int64_t remainingTime = time - esp_timer_get_time();
+  if (remainingTime > 0)
+    esp_rom_delay_us(remainingTime);
+}
+
+//==============================================================================
+
+static TickType_t GetRemainingTime(TickType_t startTick, TickType_t timeout) {
+  if (timeout == portMAX_DELAY)
+    return portMAX_DELAY;
+  TickType_t elapsedTime = xTaskGetTickCount() - startTick;
+  return elapsedTime < timeout ? timeout - elapsedTime : 0;
+}
+
+//==============================================================================
+
+SleepTimer::SleepTimer() {
+  if (!(semaphore = xSemaphoreCreateBinary()))
+    return;
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = TimerCallback;
+  timerArgs.arg = semaphore;
+  timerArgs.dispatch_method = ESP_TIMER_TASK;
+  timerArgs.name = "pl_uart_sleep";
+  if (esp_timer_create(&timerArgs, &timer) != ESP_OK)
+    timer = NULL;
+}
+
+//==============================================================================
+
+SleepTimer::~SleepTimer() {
+  if (timer) {
+    esp_timer_stop(timer);
+    esp_timer_delete(timer);
+  }
+  if (semaphore)
+    vSemaphoreDelete(semaphore);
+}
+
+//==============================================================================
+
+bool SleepTimer::IsCreated() const {
+  return semaphore && timer;
+}
+
+//==============================================================================
+
+void SleepTimer::SleepUntil(int64_t time) {
+  // The one-shot timer wakes the task up at the spin margin before the time, so only the margin is busy-waited
+  int64_t sleepTime = time - spinMargin - esp_timer_get_time();
+  if (sleepTime > 0 && esp_timer_start_once(timer, sleepTime) == ESP_OK)
+    xSemaphoreTake(semaphore, portMAX_DELAY);
+  WaitUntil(time);
+}
+
+//==============================================================================
+
+void SleepTimer::TimerCallback(void* semaphore) {
+  xSemaphoreGive((SemaphoreHandle_t)semaphore);
+}
+
+//==============================================================================
+
+}
\ No newline at end of file
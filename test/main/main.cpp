@@ -7,6 +7,12 @@
 extern "C" void app_main(void) {
   UNITY_BEGIN();
   RUN_TEST(TestUart);
+  RUN_TEST(TestUartWakeup);
+  RUN_TEST(TestUartReplay);
+  RUN_TEST(TestUartTxPriority);
+  RUN_TEST(TestUartBreak);
+  RUN_TEST(TestUartAsync);
+  RUN_TEST(TestUartAddressFilter);
   RUN_TEST(TestUartServer);
   UNITY_END();
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "uart_base.h"
 #include "unity.h"
+#include "esp_timer.h"
 
 //==============================================================================
 
@@ -10,6 +11,7 @@ const PL::UartParity parity = PL::UartParity::even;
 const PL::UartStopBits stopBits = PL::UartStopBits::two;
 const PL::UartFlowControl flowControl = PL::UartFlowControl::rtsCts;
 const TickType_t timeout = 1000 / portTICK_PERIOD_MS;
+const int rxBufferSize = 1024;
 const uint8_t dataToSend[] = {1, 2, 3, 4, 5};
 
 //==============================================================================
@@ -25,6 +27,7 @@ void TestUart() {
   TEST_ASSERT_EQUAL(PL::Uart::defaultFlowControl, uart.GetFlowControl());
 
   TEST_ASSERT(uart.Initialize() == ESP_OK);
+  TEST_ASSERT(!uart_is_driver_installed(portNumber));
 
   TEST_ASSERT(uart.EnableLoopback() == ESP_OK);
   TEST_ASSERT(uart.SetMode(UART_MODE_UART) == ESP_OK);
@@ -46,6 +49,7 @@ void TestUart() {
 
   TEST_ASSERT(uart.Enable() == ESP_OK);
   TEST_ASSERT(uart.IsEnabled());
+  TEST_ASSERT(uart_is_driver_installed(portNumber));
 
   TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
   vTaskDelay(10);
@@ -55,7 +59,322 @@ void TestUart() {
   for (int i = 0; i < sizeof(dataToSend); i++)
     TEST_ASSERT_EQUAL(dataToSend[i], receivedData[i]);
 
+  TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(uart.SetRxBufferSize(rxBufferSize) == ESP_OK);
+  TEST_ASSERT_EQUAL(rxBufferSize, uart.GetRxBufferSize());
+  TEST_ASSERT(uart.SetTxBufferSize(0) == ESP_OK);
+  TEST_ASSERT_EQUAL(0, uart.GetTxBufferSize());
+  TEST_ASSERT_EQUAL(sizeof(dataToSend), uart.GetReadableSize());
+  TEST_ASSERT(uart.Read(receivedData, sizeof(receivedData)) == ESP_OK);
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], receivedData[i]);
+
   TEST_ASSERT(uart.Disable() == ESP_OK);
   TEST_ASSERT(uart.DisableLoopback() == ESP_OK);
   TEST_ASSERT(!uart.IsEnabled());
+}
+
+//==============================================================================
+
+void TestUartWakeup() {
+  const uint8_t preamble[] = {PL::Uart::defaultWakeupPreambleByte, PL::Uart::defaultWakeupPreambleByte};
+
+  PL::Uart uart(portNumber);
+  TEST_ASSERT(uart.Initialize() == ESP_OK);
+  TEST_ASSERT(uart.EnableLoopback() == ESP_OK);
+  TEST_ASSERT(uart.EnableWakeup(PL::Uart::minWakeupThreshold - 1) == ESP_ERR_INVALID_ARG);
+  TEST_ASSERT(uart.EnableWakeup(PL::Uart::defaultWakeupThreshold, PL::UartWakeupPreamble::discard) == ESP_OK);
+  TEST_ASSERT(uart.Enable() == ESP_OK);
+
+  // The preamble is kept unless the chip is woken up by the port
+  uint8_t receivedData[sizeof(preamble) + sizeof(dataToSend)];
+  TEST_ASSERT(uart.Write(preamble, sizeof(preamble)) == ESP_OK);
+  TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(uart.PrepareForLightSleep() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(uart.ResumeFromLightSleep(ESP_SLEEP_WAKEUP_TIMER) == ESP_OK);
+  TEST_ASSERT(uart.Read(receivedData, sizeof(receivedData)) == ESP_OK);
+  for (int i = 0; i < sizeof(preamble); i++)
+    TEST_ASSERT_EQUAL(preamble[i], receivedData[i]);
+
+  TEST_ASSERT(uart.Write(preamble, sizeof(preamble)) == ESP_OK);
+  TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(uart.PrepareForLightSleep() == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT(uart.ResumeFromLightSleep(ESP_SLEEP_WAKEUP_UART) == ESP_OK);
+  TEST_ASSERT(uart.Read(receivedData, sizeof(dataToSend)) == ESP_OK);
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], receivedData[i]);
+  TEST_ASSERT_EQUAL(0, uart.GetReadableSize());
+
+  TEST_ASSERT(uart.DisableWakeup() == ESP_OK);
+  TEST_ASSERT(uart.DisableWakeup() == ESP_OK);
+  TEST_ASSERT(uart.Disable() == ESP_OK);
+}
+
+//==============================================================================
+
+void TestUartReplay() {
+  const uint32_t chunkDelay = 20000;
+  const uint32_t breakDuration = 1000;
+  PL::UartTraffic traffic = {{0, {1, 2, 3}}, {chunkDelay, {4, 5}}};
+  
+  PL::Uart uart(portNumber);
+  TEST_ASSERT(uart.Initialize() == ESP_OK);
+  TEST_ASSERT(uart.EnableLoopback() == ESP_OK);
+  TEST_ASSERT(uart.Enable() == ESP_OK);
+
+  int64_t startTime = esp_timer_get_time();
+  TEST_ASSERT(uart.Replay(traffic) == ESP_OK);
+  TEST_ASSERT(esp_timer_get_time() - startTime >= chunkDelay);
+  uint8_t receivedData[sizeof(dataToSend)];
+  TEST_ASSERT(uart.Read(receivedData, sizeof(receivedData)) == ESP_OK);
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], receivedData[i]);
+
+  auto recording = std::make_shared<PL::UartTraffic>();
+  TEST_ASSERT(uart.StartTxRecording(recording) == ESP_OK);
+  TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(uart.SendBreak(breakDuration) == ESP_OK);
+  TEST_ASSERT(uart.StopTxRecording() == ESP_OK);
+  TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT_EQUAL(2, recording->size());
+  TEST_ASSERT_EQUAL(sizeof(dataToSend), (*recording)[0].data.size());
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], (*recording)[0].data[i]);
+  TEST_ASSERT_EQUAL(0, (*recording)[0].breakDuration);
+  TEST_ASSERT_EQUAL(0, (*recording)[1].data.size());
+  TEST_ASSERT_EQUAL(breakDuration, (*recording)[1].breakDuration);
+
+  TEST_ASSERT(uart.Disable() == ESP_OK);
+}
+
+//==============================================================================
+
+void TestUartTxPriority() {
+  const size_t bulkFrameSize = 100;
+  uint8_t bulkFrame[bulkFrameSize];
+  for (int i = 0; i < bulkFrameSize; i++)
+    bulkFrame[i] = 0;
+
+  PL::Uart uart(portNumber, 1024);
+  TEST_ASSERT(uart.Initialize() == ESP_OK);
+  TEST_ASSERT(uart.EnableLoopback() == ESP_OK);
+  TEST_ASSERT(uart.Enable() == ESP_OK);
+  TEST_ASSERT(uart.EnableTxPriorityQueue() == ESP_OK);
+  auto recording = std::make_shared<PL::UartTraffic>();
+  TEST_ASSERT(uart.StartTxRecording(recording) == ESP_OK);
+
+  // The high priority frame should preempt the second bulk frame
+  TEST_ASSERT(uart.Write(bulkFrame, sizeof(bulkFrame), PL::UartTxPriority::low) == ESP_OK);
+  TEST_ASSERT(uart.Write(bulkFrame, sizeof(bulkFrame), PL::UartTxPriority::low) == ESP_OK);
+  TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend), PL::UartTxPriority::high) == ESP_OK);
+  TEST_ASSERT(uart.DisableTxPriorityQueue() == ESP_OK);
+  TEST_ASSERT(uart.StopTxRecording() == ESP_OK);
+
+  // The frames are recorded in the order they are sent
+  TEST_ASSERT_EQUAL(3, recording->size());
+  TEST_ASSERT_EQUAL(bulkFrameSize, (*recording)[0].data.size());
+  TEST_ASSERT_EQUAL(sizeof(dataToSend), (*recording)[1].data.size());
+  TEST_ASSERT_EQUAL(bulkFrameSize, (*recording)[2].data.size());
+
+  uint8_t receivedData[bulkFrameSize + sizeof(dataToSend)];
+  TEST_ASSERT(uart.Read(receivedData, sizeof(receivedData)) == ESP_OK);
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], receivedData[bulkFrameSize + i]);
+  TEST_ASSERT(uart.Read(receivedData, bulkFrameSize) == ESP_OK);
+
+  TEST_ASSERT(uart.Disable() == ESP_OK);
+}
+
+//==============================================================================
+
+class TestUartBreakHandler {
+public:
+  int numberOfBreaks = 0;
+
+  void HandleBreak(PL::Uart& uart) {
+    numberOfBreaks++;
+  }
+};
+
+//==============================================================================
+
+void TestUartBreak() {
+  const uint32_t breakDuration = 1000;
+  const uint32_t markDuration = 100;
+  const size_t bulkFrameSize = 100;
+  uint8_t bulkFrame[bulkFrameSize] = {};
+  const uint8_t nextDataToSend[] = {6, 7, 8};
+
+  PL::Uart uart(portNumber, rxBufferSize);
+  auto breakHandler = std::make_shared<TestUartBreakHandler>();
+  uart.breakEvent.AddHandler(breakHandler, &TestUartBreakHandler::HandleBreak);
+  TEST_ASSERT(uart.Initialize() == ESP_OK);
+  TEST_ASSERT(uart.EnableLoopback() == ESP_OK);
+  TEST_ASSERT(uart.SetRxFraming(PL::UartRxFraming::breakDelimited) == ESP_OK);
+  TEST_ASSERT_EQUAL(PL::UartRxFraming::breakDelimited, uart.GetRxFraming());
+  TEST_ASSERT(uart.Enable() == ESP_OK);
+
+  // The frames written back to back with the breaks are split exactly at the breaks
+  TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  TEST_ASSERT(uart.SendBreak(breakDuration, markDuration) == ESP_OK);
+  TEST_ASSERT(uart.Write(nextDataToSend, sizeof(nextDataToSend)) == ESP_OK);
+  TEST_ASSERT(uart.SendBreak(breakDuration, markDuration) == ESP_OK);
+  std::vector<uint8_t> frame;
+  TEST_ASSERT(uart.ReadFrame(frame) == ESP_OK);
+  TEST_ASSERT_EQUAL(sizeof(dataToSend), frame.size());
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], frame[i]);
+  TEST_ASSERT(uart.ReadFrame(frame) == ESP_OK);
+  TEST_ASSERT_EQUAL(sizeof(nextDataToSend), frame.size());
+  for (int i = 0; i < sizeof(nextDataToSend); i++)
+    TEST_ASSERT_EQUAL(nextDataToSend[i], frame[i]);
+  TEST_ASSERT_EQUAL(2, breakHandler->numberOfBreaks);
+
+  TEST_ASSERT(uart.SetRxFraming(PL::UartRxFraming::none) == ESP_OK);
+  TEST_ASSERT(uart.ReadFrame(frame) == ESP_ERR_INVALID_STATE);
+  TEST_ASSERT(uart.Read(NULL, uart.GetReadableSize()) == ESP_OK);
+
+  // The break is sent after the lower priority frames written before it and before the higher priority frame written after it
+  TEST_ASSERT(uart.EnableTxPriorityQueue() == ESP_OK);
+  TEST_ASSERT(uart.Write(bulkFrame, sizeof(bulkFrame), PL::UartTxPriority::low) == ESP_OK);
+  TEST_ASSERT(uart.Write(bulkFrame, sizeof(bulkFrame), PL::UartTxPriority::low) == ESP_OK);
+  TEST_ASSERT(uart.SendBreak(breakDuration, markDuration) == ESP_OK);
+  TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend), PL::UartTxPriority::high) == ESP_OK);
+  TEST_ASSERT(uart.DisableTxPriorityQueue() == ESP_OK);
+  vTaskDelay(10);
+  std::vector<uint8_t> receivedData(uart.GetReadableSize());
+  TEST_ASSERT(receivedData.size() >= 2 * bulkFrameSize + sizeof(dataToSend));
+  TEST_ASSERT(uart.Read(receivedData.data(), receivedData.size()) == ESP_OK);
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], receivedData[receivedData.size() - sizeof(dataToSend) + i]);
+
+  TEST_ASSERT(uart.Disable() == ESP_OK);
+}
+
+//==============================================================================
+
+static PL::UartCoroutine TestUartAsyncRead(PL::Uart& uart, void* dest, size_t size, esp_err_t& result) {
+  result = co_await uart.ReadAsync(dest, size);
+}
+
+//==============================================================================
+
+static PL::UartCoroutine TestUartAsyncWrite(PL::Uart& uart, const void* src, size_t size, esp_err_t& result) {
+  result = co_await uart.WriteAsync(src, size);
+}
+
+//==============================================================================
+
+static PL::UartCoroutine TestUartAsyncReadFrame(PL::Uart& uart, std::vector<uint8_t>& frame, esp_err_t& result) {
+  result = co_await uart.WriteAsync(dataToSend, sizeof(dataToSend), PL::UartTxPriority::high);
+  if (result == ESP_OK)
+    result = co_await uart.ReadFrameAsync(frame);
+}
+
+//==============================================================================
+
+void TestUartAsync() {
+  const size_t largeDataSize = PL::Uart::minBufferSize * 3;
+  const TickType_t shortTimeout = 10;
+
+  PL::UartScheduler scheduler;
+  PL::Uart uart(portNumber);
+  TEST_ASSERT(uart.Initialize() == ESP_OK);
+  TEST_ASSERT(uart.EnableLoopback() == ESP_OK);
+  TEST_ASSERT(uart.Enable() == ESP_OK);
+
+  // The asynchronous write requires the TX priority queue
+  esp_err_t readResult = ESP_FAIL, writeResult = ESP_FAIL;
+  TEST_ASSERT(scheduler.Spawn(TestUartAsyncWrite(uart, dataToSend, sizeof(dataToSend), writeResult)) == ESP_OK);
+  while (scheduler.RunOnce(timeout) == ESP_OK);
+  TEST_ASSERT(writeResult == ESP_ERR_INVALID_STATE);
+  TEST_ASSERT(uart.EnableTxPriorityQueue() == ESP_OK);
+
+  // The read is larger than the RX buffer
+  std::vector<uint8_t> largeData(largeDataSize), receivedData(largeDataSize);
+  for (int i = 0; i < largeDataSize; i++)
+    largeData[i] = i;
+  writeResult = ESP_FAIL;
+  TEST_ASSERT(scheduler.Spawn(TestUartAsyncRead(uart, receivedData.data(), receivedData.size(), readResult)) == ESP_OK);
+  TEST_ASSERT(scheduler.Spawn(TestUartAsyncWrite(uart, largeData.data(), largeData.size(), writeResult)) == ESP_OK);
+  while (scheduler.RunOnce(timeout) == ESP_OK);
+  TEST_ASSERT(writeResult == ESP_OK);
+  TEST_ASSERT(readResult == ESP_OK);
+  TEST_ASSERT(receivedData == largeData);
+
+  TEST_ASSERT(uart.SetReadTimeout(shortTimeout) == ESP_OK);
+  readResult = ESP_FAIL;
+  TEST_ASSERT(scheduler.Spawn(TestUartAsyncRead(uart, receivedData.data(), 1, readResult)) == ESP_OK);
+  while (scheduler.RunOnce(timeout) == ESP_OK);
+  TEST_ASSERT(readResult == ESP_ERR_TIMEOUT);
+  TEST_ASSERT(uart.SetReadTimeout(timeout) == ESP_OK);
+
+  std::vector<uint8_t> frame;
+  esp_err_t frameResult = ESP_FAIL;
+  TEST_ASSERT(uart.SetRxFraming(PL::UartRxFraming::idleDelimited) == ESP_OK);
+  TEST_ASSERT(scheduler.Spawn(TestUartAsyncReadFrame(uart, frame, frameResult)) == ESP_OK);
+  while (scheduler.RunOnce(timeout) == ESP_OK);
+  TEST_ASSERT(frameResult == ESP_OK);
+  TEST_ASSERT(frame == std::vector<uint8_t>(dataToSend, dataToSend + sizeof(dataToSend)));
+  TEST_ASSERT(uart.SetRxFraming(PL::UartRxFraming::none) == ESP_OK);
+
+  // The pending read survives the RX buffer resizing
+  readResult = ESP_FAIL;
+  TEST_ASSERT(scheduler.Spawn(TestUartAsyncRead(uart, receivedData.data(), sizeof(dataToSend), readResult)) == ESP_OK);
+  TEST_ASSERT(scheduler.RunOnce(0) == ESP_OK);
+  TEST_ASSERT(uart.SetRxBufferSize(rxBufferSize) == ESP_OK);
+  TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  while (scheduler.RunOnce(timeout) == ESP_OK);
+  TEST_ASSERT(readResult == ESP_OK);
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], receivedData[i]);
+
+  TEST_ASSERT(uart.DisableTxPriorityQueue() == ESP_OK);
+  TEST_ASSERT(uart.Disable() == ESP_OK);
+}
+
+//==============================================================================
+
+void TestUartAddressFilter() {
+  const uint8_t otherNodeFrame[] = {9, 9, 9};
+
+  PL::Uart uart(portNumber);
+  TEST_ASSERT(uart.Initialize() == ESP_OK);
+  TEST_ASSERT(uart.EnableLoopback() == ESP_OK);
+  TEST_ASSERT(uart.EnableAddressFilter(dataToSend[0]) == ESP_ERR_INVALID_STATE);
+  TEST_ASSERT(uart.SetRxFraming(PL::UartRxFraming::idleDelimited) == ESP_OK);
+  TEST_ASSERT(uart.EnableAddressFilter(dataToSend[0]) == ESP_OK);
+  TEST_ASSERT(uart.Enable() == ESP_OK);
+
+  TEST_ASSERT(uart.Write(otherNodeFrame, sizeof(otherNodeFrame)) == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(0, uart.GetReadableSize());
+  TEST_ASSERT(uart.Write(dataToSend, sizeof(dataToSend)) == ESP_OK);
+  vTaskDelay(10);
+  TEST_ASSERT_EQUAL(sizeof(dataToSend), uart.GetReadableSize());
+  std::vector<uint8_t> frame;
+  TEST_ASSERT(uart.ReadFrame(frame) == ESP_OK);
+  TEST_ASSERT_EQUAL(sizeof(dataToSend), frame.size());
+  for (int i = 0; i < sizeof(dataToSend); i++)
+    TEST_ASSERT_EQUAL(dataToSend[i], frame[i]);
+
+  // Back-to-back frames separated only by the idle time are filtered separately in both orders
+  const uint32_t frameGap = 1000;
+  std::vector<uint8_t> otherNodeData(otherNodeFrame, otherNodeFrame + sizeof(otherNodeFrame));
+  std::vector<uint8_t> data(dataToSend, dataToSend + sizeof(dataToSend));
+  for (auto& traffic : {PL::UartTraffic{{0, otherNodeData}, {frameGap, data}}, PL::UartTraffic{{0, data}, {frameGap, otherNodeData}}}) {
+    TEST_ASSERT(uart.Replay(traffic) == ESP_OK);
+    vTaskDelay(10);
+    TEST_ASSERT_EQUAL(sizeof(dataToSend), uart.GetReadableSize());
+    TEST_ASSERT(uart.ReadFrame(frame) == ESP_OK);
+    TEST_ASSERT(frame == data);
+    TEST_ASSERT_EQUAL(0, uart.GetReadableSize());
+  }
+
+  TEST_ASSERT(uart.DisableAddressFilter() == ESP_OK);
+  TEST_ASSERT(uart.SetRxFraming(PL::UartRxFraming::none) == ESP_OK);
+  TEST_ASSERT(uart.Disable() == ESP_OK);
 }
\ No newline at end of file
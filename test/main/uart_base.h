@@ -2,4 +2,10 @@
 
 //==============================================================================
 
-void TestUart();
\ No newline at end of file
+void TestUart();
+void TestUartWakeup();
+void TestUartReplay();
+void TestUartTxPriority();
+void TestUartBreak();
+void TestUartAsync();
+void TestUartAddressFilter();
\ No newline at end of file